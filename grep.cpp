@@ -0,0 +1,231 @@
+#include "regex_engine.h"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * RegexGrep: prints the lines of the input files that the pattern matches. Like Regex::eval, the pattern has to match
+ * the whole line (as with grep -x).
+ *
+ * Every file is memory mapped and split into newline aligned chunks that are matched in parallel against one shared
+ * Regex. Lines are passed to the Regex as views into the mapping, so nothing is copied. Chunks are processed in windows
+ * of a few chunks per thread and the results of a window are printed in input order before the next one starts, so the
+ * memory used for results stays bounded.
+ *
+ * Usage: RegexGrep [-c] [-b] [-n] [-j threads] pattern file...
+ *   -c  print only the number of matching lines of every file
+ *   -b  print the byte offset of every matching line
+ *   -n  print the line number of every matching line
+ *   -j  number of threads, the number of cores by default
+ */
+
+namespace {
+    constexpr size_t chunk_bytes = 4u << 20;
+    constexpr size_t chunks_per_thread = 4;
+
+    struct Options {
+        bool count_only = false;
+        bool byte_offsets = false;
+        bool line_numbers = false;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    struct LineMatch {
+        std::string_view line;
+        size_t offset;
+        size_t line_index; // inside the chunk
+    };
+
+    struct Chunk {
+        Chunk(size_t begin, size_t end) : begin(begin), end(end) {}
+
+        size_t begin;
+        size_t end;
+        size_t lines = 0;
+        std::vector<LineMatch> matches;
+        size_t match_count = 0;
+    };
+
+    /*
+     * A read-only memory mapping of a whole file, unmapped when it goes out of scope.
+     */
+
+    class MappedFile {
+    public:
+        explicit MappedFile(const char *path) {
+            int fd = open(path, O_RDONLY);
+            if(fd < 0) throw std::runtime_error(std::string(path) + ": " + std::strerror(errno));
+            struct stat st{};
+            if(fstat(fd, &st) < 0) {
+                close(fd);
+                throw std::runtime_error(std::string(path) + ": " + std::strerror(errno));
+            }
+            this->size = static_cast<size_t>(st.st_size);
+            if(this->size > 0) {
+                void *mapping = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(mapping == MAP_FAILED) {
+                    close(fd);
+                    throw std::runtime_error(std::string(path) + ": " + std::strerror(errno));
+                }
+                madvise(mapping, this->size, MADV_SEQUENTIAL);
+                this->data = static_cast<const char *>(mapping);
+            }
+            close(fd);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile() {
+            if(this->data) munmap(const_cast<char *>(this->data), this->size);
+        }
+
+        [[nodiscard]] std::string_view view() const {
+            return {this->data, this->size};
+        }
+    private:
+        const char *data = nullptr;
+        size_t size = 0;
+    };
+
+    /*
+     * Splits the text into chunks of about chunk_bytes that end right after a newline (or at the end of the text).
+     */
+
+    std::vector<Chunk> split_chunks(std::string_view text) {
+        std::vector<Chunk> chunks;
+        size_t begin = 0;
+        while(begin < text.size()) {
+            size_t end = begin + chunk_bytes;
+            if(end >= text.size()) {
+                end = text.size();
+            }
+            else {
+                size_t newline = text.find('\n', end - 1);
+                end = newline == std::string_view::npos ? text.size() : newline + 1;
+            }
+            chunks.emplace_back(begin, end);
+            begin = end;
+        }
+        return chunks;
+    }
+
+    void scan_chunk(const Regex &regex, std::string_view text, Chunk &chunk, const Options &options) {
+        size_t begin = chunk.begin;
+        while(begin < chunk.end) {
+            size_t newline = text.find('\n', begin);
+            size_t end = newline == std::string_view::npos || newline >= chunk.end ? chunk.end : newline;
+            std::string_view line = text.substr(begin, end - begin);
+            if(regex.eval(line)) {
+                chunk.match_count++;
+                if(!options.count_only) chunk.matches.push_back({line, begin, chunk.lines});
+            }
+            chunk.lines++;
+            begin = end + 1;
+        }
+    }
+
+    size_t scan_file(const Regex &regex, const char *path, bool print_path, const Options &options) {
+        MappedFile file(path);
+        const std::string_view text = file.view();
+        std::vector<Chunk> chunks = split_chunks(text);
+
+        size_t match_count = 0, line_number = 1;
+        const size_t window = options.threads * chunks_per_thread;
+        for(size_t first = 0; first < chunks.size(); first += window) {
+            const size_t last = std::min(chunks.size(), first + window);
+            std::atomic<size_t> next = first;
+            std::vector<std::thread> threads;
+            for(size_t t = 0; t < std::min(options.threads, last - first); t++) {
+                threads.emplace_back([&]() {
+                    for(size_t i = next++; i < last; i = next++) {
+                        scan_chunk(regex, text, chunks[i], options);
+                    }
+                });
+            }
+            for(auto &thread : threads) thread.join();
+
+            for(size_t i = first; i < last; i++) {
+                for(const auto &match : chunks[i].matches) {
+                    if(print_path) std::cout << path << ':';
+                    if(options.line_numbers) std::cout << line_number + match.line_index << ':';
+                    if(options.byte_offsets) std::cout << match.offset << ':';
+                    std::cout.write(match.line.data(), static_cast<std::streamsize>(match.line.size()));
+                    std::cout << '\n';
+                }
+                match_count += chunks[i].match_count;
+                line_number += chunks[i].lines;
+                chunks[i].matches = {};
+            }
+        }
+
+        if(options.count_only) {
+            if(print_path) std::cout << path << ':';
+            std::cout << match_count << '\n';
+        }
+        return match_count;
+    }
+
+    void usage() {
+        std::cerr << "Usage: RegexGrep [-c] [-b] [-n] [-j threads] pattern file...\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+    Options options;
+    int arg = 1;
+    for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != 0; arg++) {
+        std::string_view flag = argv[arg];
+        if(flag == "-c") options.count_only = true;
+        else if(flag == "-b") options.byte_offsets = true;
+        else if(flag == "-n") options.line_numbers = true;
+        else if(flag == "-j" && arg + 1 < argc) {
+            options.threads = std::max(1ul, std::strtoul(argv[++arg], nullptr, 10));
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if(argc - arg < 2) {
+        usage();
+        return 2;
+    }
+
+    std::unique_ptr<Regex> regex;
+    try {
+        regex = std::make_unique<Regex>(argv[arg++]);
+    }
+    catch(const ExpressionNotRegex &) {
+        std::cerr << "RegexGrep: invalid pattern '" << argv[arg - 1] << "'\n";
+        return 2;
+    }
+
+    size_t match_count = 0;
+    bool failed = false;
+    const bool print_path = argc - arg > 1;
+    for(; arg < argc; arg++) {
+        try {
+            match_count += scan_file(*regex, argv[arg], print_path, options);
+        }
+        catch(const std::runtime_error &error) {
+            std::cerr << "RegexGrep: " << error.what() << '\n';
+            failed = true;
+        }
+    }
+    std::cout.flush();
+    return failed ? 2 : (match_count > 0 ? 0 : 1);
+}
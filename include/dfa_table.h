@@ -0,0 +1,51 @@
+#ifndef LAMBDANFA_DFA_TABLE_H
+#define LAMBDANFA_DFA_TABLE_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "lambda_nfa.h"
+
+class AutomatonNotDeterministic : std::exception {};
+
+/*
+ * A DFA (as built by Automaton::to_dfa) flattened into a dense transition table with 256 columns, one per byte. State 0
+ * is an added dead state that every missing transition goes to. Every entry already holds the row offset of its
+ * destination (state * 256), so a step is a single load: state = table[state + byte].
+ *
+ * The offsets are 32 bit, so a DfaTable holds at most max_states states (the dead one included). The constructor throws
+ * DfaLimitExceeded for a larger DFA.
+ */
+
+class DfaTable {
+public:
+    static constexpr size_t max_states = size_t(1) << 24;
+    static constexpr size_t row_bytes = 256 * sizeof(uint32_t);
+
+    DfaTable();
+    explicit DfaTable(const Automaton &dfa);
+
+    bool accept(std::string_view word) const;
+
+    /*
+     * Runs several words at once and stores in results[i] whether words[i] is accepted. The words are streamed through
+     * 8 lanes that are advanced in lockstep, one char of every lane per step, so the 8 independent table loads overlap
+     * instead of each one waiting on the previous. Each lane is independent: the lanes are checked every few steps and
+     * once a word ends or reaches the dead state its lane stores the result and takes the next pending word, so short
+     * words and words that die early do not hold back the others. When no words are left the lanes that are still
+     * running are finished on their own.
+     */
+
+    void accept_batch(const std::vector<std::string_view> &words, std::vector<bool> &results) const;
+    [[nodiscard]] size_t state_count() const;
+private:
+    static constexpr uint32_t dead_state = 0;
+
+    std::vector<uint32_t> table;
+    std::vector<uint8_t> terminal;
+    uint32_t init_state;
+
+    uint32_t run(uint32_t state, const unsigned char *begin, const unsigned char *end) const;
+};
+
+#endif //LAMBDANFA_DFA_TABLE_H
@@ -2,13 +2,43 @@
 #define LAMBDANFA_LAMBDA_NFA_H
 
 #include <iostream>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
 #include <set>
+#include <cstdint>
+#include <limits>
 
 class NfaHasLambda : std::exception {};
 
+/*
+ * Limits for the subset construction. The byte count is an estimate of the memory held by the input automaton, the DFA
+ * being built, the state sets that index it and the successor sets waiting to be numbered. It is reserved before the
+ * memory is allocated, so the construction stops before going over it.
+ *
+ * extra_state_bytes is charged for every DFA state on top of that, for a caller that builds something sized by the
+ * states from the result (Regex sets it to the size of a DfaTable row).
+ */
+
+struct DfaLimits {
+    size_t max_states = std::numeric_limits<size_t>::max();
+    size_t max_bytes = std::numeric_limits<size_t>::max();
+    size_t extra_state_bytes = 0;
+};
+
+/*
+ * Thrown by to_dfa when the DFA under construction would go over one of its DfaLimits. states and bytes are what the
+ * construction had reached when it was aborted. DfaTable throws it too for a DFA with more states than it can address.
+ */
+
+class DfaLimitExceeded : std::exception {
+public:
+    DfaLimitExceeded(size_t states, size_t bytes) : states(states), bytes(bytes) {}
+    size_t states;
+    size_t bytes;
+};
+
 class Node;
 
 /*
@@ -66,32 +96,85 @@ public:
 
 class Automaton {
 private:
-    using IntSet = std::set<int>;
-    using CharSet = std::set<char>;
+    /*
+     * A set of states of a DenseNfa stored as a bitset, with its hash precomputed so that subset construction can
+     * deduplicate state sets in a hash table without rehashing them on every lookup.
+     */
+
+    class StateSet {
+    public:
+        explicit StateSet(size_t state_count = 0);
+        void insert(int state);
+        [[nodiscard]] bool contains(int state) const;
+        [[nodiscard]] bool empty() const;
+        [[nodiscard]] bool intersects(const StateSet &other) const;
+        [[nodiscard]] size_t hash() const;
+        void seal();
+        bool operator==(const StateSet &other) const;
+        template<typename F> void for_each(F f) const;
+
+        struct Hash {
+            size_t operator()(const StateSet &state_set) const { return state_set.hash(); }
+        };
+    private:
+        std::vector<uint64_t> words;
+        size_t hash_value;
+    };
+
+    /*
+     * The automaton renumbered to the states 0..n-1 (in increasing order of the original states), with the edges in
+     * flat vectors. It is what the algorithms that work on state sets iterate over.
+     */
+
+    struct DenseNfa {
+        std::vector<int> states;
+        std::vector<std::vector<std::pair<char, int> > > edges;
+        std::vector<std::vector<int> > lambda_edges;
+        StateSet terminal;
+        int init_state = 0;
+    };
+
     int init_state;
     std::unordered_map<int, Node> nodes;
-    IntSet get_state_set(const IntSet &state_set, char trans_char) const;
-    CharSet get_trans_char_set(const IntSet &state_set) const;
-    bool check_state_set_terminal(const IntSet &state_set);
+    [[nodiscard]] DenseNfa make_dense() const;
 //    std::unordered_set<int> term_states;
 public:
     Automaton();
     explicit Automaton(char trans_char);
     void insert_node(int state);
     void insert_edge(int dest, int src, char tc);
+    void set_terminal(int state, bool is = true);
+    void set_init_state(int state);
+    [[nodiscard]] int get_init_state() const;
+    [[nodiscard]] const std::unordered_map<int, Node> &get_nodes() const;
+
+    /*
+     * Converts an NFA to a new DFA, without changing the initial object. Lambda transitions are followed while the
+     * state sets are built (every set is closed under them), so a lambda NFA does not need without_lambda first.
+     *
+     * The subset construction goes frontier by frontier: the successors of every state set in the frontier are
+     * computed in parallel, then numbered sequentially in (frontier, char) order, so the resulting DFA is the same on
+     * every run no matter the number of threads.
+     *
+     * If limits are given and the DFA would go over them, the construction is aborted with DfaLimitExceeded.
+     */
+
+    [[nodiscard]] Automaton to_dfa(const DfaLimits &limits = DfaLimits()) const;
 
     /*
-     * Converts a valid non-lambda NFA to a new DFA, without changing the initial object.
+     * Returns an equivalent NFA without lambda transitions, keeping the same states. Every state gets the transitions
+     * of its lambda closure and becomes terminal if its closure contains a terminal state. The result can have
+     * quadratically more edges than this automaton, to_dfa does not need it.
      */
 
-    Automaton to_dfa();
+    [[nodiscard]] Automaton without_lambda() const;
 
     /*
      * The accept function. Iterative implementation was preferred over the recursive one because for very large words
      * the stack would run out of space and crash the program. In this way, the program is also more memory efficient.
      */
 
-    bool accept(const std::string &word);
+    bool accept(std::string_view word) const;
 
     /*
      * Union between 2 automatons.
@@ -113,6 +196,51 @@ public:
 
     Automaton operator*();
 
+    /*
+     * Intersection between 2 automatons, by product construction over the reachable pairs of states. Lambda
+     * transitions are removed from the operands first.
+     */
+
+    Automaton operator&(const Automaton &other) const;
+    Automaton &operator&=(const Automaton &other);
+
+    /*
+     * Complement over the given alphabet: the result accepts every word over alphabet that this automaton rejects.
+     * The automaton is determinized and completed with a sink state first. The determinization is bounded by limits
+     * and throws DfaLimitExceeded like to_dfa.
+     */
+
+    [[nodiscard]] Automaton complement(const std::set<char> &alphabet, const DfaLimits &limits = DfaLimits()) const;
+
+    /*
+     * Difference between 2 automatons, the words accepted by this one and rejected by other. Computed as the
+     * intersection with the complement of other over the alphabet of this automaton, so limits bound the
+     * determinization of other. The operators use no limits.
+     */
+
+    [[nodiscard]] Automaton difference(const Automaton &other, const DfaLimits &limits = DfaLimits()) const;
+    Automaton operator-(const Automaton &other) const;
+    Automaton &operator-=(const Automaton &other);
+
+    /*
+     * The transition chars used by the automaton, lambda excluded.
+     */
+
+    [[nodiscard]] std::set<char> alphabet() const;
+
+    /*
+     * Checks whether the automaton accepts no word, i.e. no terminal state is reachable from the initial state.
+     */
+
+    [[nodiscard]] bool is_empty() const;
+
+    /*
+     * Checks whether every word accepted by other is also accepted by this automaton. It determinizes this automaton,
+     * bounded by limits.
+     */
+
+    [[nodiscard]] bool includes(const Automaton &other, const DfaLimits &limits = DfaLimits()) const;
+
     friend std::istream &operator>>(std::istream &in, Automaton &automaton);
 
     [[maybe_unused]] void print() const;
@@ -0,0 +1,68 @@
+#ifndef LAMBDANFA_LITERAL_MATCHER_H
+#define LAMBDANFA_LITERAL_MATCHER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include "lambda_nfa.h"
+
+class SyntaxTree;
+
+/*
+ * Matches a word against a finite set of literals, for expressions that are only literals joined by OR and CONCAT,
+ * such as (foo|barbaz|qux). Like Regex::eval, the whole word has to be one of the literals.
+ *
+ * Small sets are kept packed in 16 byte blocks and compared with one SIMD compare per literal. Large sets are kept in a
+ * trie (the goto function of an Aho-Corasick automaton) with the edges of every node sorted in a flat array, so a
+ * match costs one edge lookup per char no matter how many literals there are. Regex runs the trie from to_automaton
+ * as a DfaTable instead whenever it fits in its limits, so the flat trie is only used for sets too large for a table.
+ */
+
+class LiteralMatcher {
+public:
+    static constexpr size_t packed_limit = 8;
+    static constexpr size_t max_literals = 4096;
+
+    // The packed compare only beats a DfaTable walk of the trie for words of at least this many chars.
+    static constexpr size_t packed_min_length = 12;
+
+    LiteralMatcher();
+    explicit LiteralMatcher(std::vector<std::string> literals);
+
+    /*
+     * Expands the AST into the set of words it accepts if it only contains LITERAL, OR, CONCAT and GROUP nodes and
+     * accepts at most max_literals words. Returns false otherwise.
+     */
+
+    static bool extract(const SyntaxTree &tree, std::vector<std::string> &literals);
+
+    /*
+     * Builds the trie of the literals as a DFA, in time linear in their total length.
+     */
+
+    static Automaton to_automaton(const std::vector<std::string> &literals);
+
+    bool match(std::string_view word) const;
+
+    // Whether the literals are kept packed, false for a trie or an empty matcher.
+    [[nodiscard]] bool is_packed() const;
+private:
+    bool use_trie;
+
+    // packed: literals of up to 16 bytes zero padded, longer ones kept as they are
+    std::vector<std::array<char, 16> > packed;
+    std::vector<uint8_t> packed_lengths;
+    std::vector<std::string> long_literals;
+
+    // trie: the edges of node i are [edge_begin[i], edge_begin[i + 1]), sorted by char
+    std::vector<uint32_t> edge_begin;
+    std::vector<unsigned char> edge_chars;
+    std::vector<uint32_t> edge_dest;
+    std::vector<uint8_t> terminal;
+
+    void build_trie(const std::vector<std::string> &literals);
+};
+
+#endif //LAMBDANFA_LITERAL_MATCHER_H
@@ -0,0 +1,72 @@
+#ifndef LAMBDANFA_PIKE_VM_H
+#define LAMBDANFA_PIKE_VM_H
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+class SyntaxTree;
+
+/*
+ * The offsets of a capturing group inside the matched word, as the half-open interval [begin, end). A group that did
+ * not take part in the match has both offsets set to -1.
+ */
+
+struct Submatch {
+    std::ptrdiff_t begin = -1;
+    std::ptrdiff_t end = -1;
+    [[nodiscard]] bool matched() const;
+};
+
+/*
+ * A single instruction of the Pike VM program.
+ *
+ * CHAR consumes trans_char and continues at x. SPLIT forks into x (higher priority) and y. SAVE stores the current
+ * offset in capture slot y and continues at x. MATCH accepts the word if the whole input was consumed.
+ */
+
+struct Instruction {
+    enum Opcode {
+        CHAR,
+        SPLIT,
+        SAVE,
+        MATCH
+    };
+    Opcode op;
+    char trans_char;
+    int x;
+    int y;
+};
+
+/*
+ * A Pike VM compiled from the AST built by Parser::parse. All threads are advanced in lockstep over the input, so a
+ * match takes O(input * program) time. The thread lists are sparse sets sized by the program, so the memory used by a
+ * match is bounded by program * captures no matter the input and there is no backtracking.
+ *
+ * Threads are kept in priority order (left alternative first, greedy star), so the extracted groups generally follow
+ * the leftmost-first choices of a backtracking engine such as std::regex. They can differ when a starred subexpression
+ * can match the empty word, e.g. ((c*))* on "c", since the VM does not apply ECMAScript's empty-iteration rules.
+ */
+
+class PikeVM {
+public:
+    PikeVM();
+    explicit PikeVM(const SyntaxTree &tree);
+
+    /*
+     * Matches the whole word and fills groups with group_count() + 1 submatches, groups[0] being the whole match.
+     * match is const and keeps no state between calls, so one PikeVM can be shared between threads.
+     */
+
+    bool match(std::string_view word, std::vector<Submatch> &groups) const;
+    [[nodiscard]] int group_count() const;
+    [[nodiscard]] const std::vector<Instruction> &get_program() const;
+private:
+    std::vector<Instruction> program;
+    int start;
+    int groups;
+
+    void compile(const SyntaxTree &tree);
+};
+
+#endif //LAMBDANFA_PIKE_VM_H
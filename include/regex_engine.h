@@ -2,9 +2,13 @@
 #define LAMBDANFA_REGEX_ENGINE_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include "lambda_nfa.h"
+#include "pike_vm.h"
+#include "dfa_table.h"
+#include "literal_matcher.h"
 
 class ExpressionNotRegex : std::exception {};
 
@@ -14,41 +18,113 @@ public:
         CONCAT,
         STAR,
         OR,
-        LITERAL
+        LITERAL,
+        GROUP
     };
-    explicit SyntaxTreeNode(NodeType type, char ch);
+    explicit SyntaxTreeNode(NodeType type, char ch, int group = -1);
     void set_type(NodeType node_type);
     void insert_child(int node_index);
     [[nodiscard]] NodeType get_type() const;
     [[nodiscard]] const std::vector<int> &get_children() const;
     [[nodiscard]] char get_value() const;
+    [[nodiscard]] int get_group() const;
 private:
     NodeType type;
     char value;
+    int group;
     std::vector<int> children;
 };
 
 class SyntaxTree {
 public:
-    int emplace_node(SyntaxTreeNode::NodeType type, char value);
+    int emplace_node(SyntaxTreeNode::NodeType type, char value, int group = -1);
     void insert_child(int father_index, int child_index);
     [[nodiscard]] const std::vector<SyntaxTreeNode> &get_nodes() const;
     [[nodiscard]] int root_index() const;
+    [[nodiscard]] int group_count() const;
+
+    /*
+     * Structural hashing of the subtrees: two nodes get the same id iff their subtrees are identical (same types, values
+     * and children, recursively). GROUP nodes get the id of their child, since they do not change the language.
+     */
+
+    [[nodiscard]] std::vector<int> structural_ids() const;
 private:
     std::vector<SyntaxTreeNode> nodes;
+    int groups = 0;
 };
 
+/*
+ * A compiled regex expression. The lambda NFA built from the AST is determinized if the DFA fits in the given limits,
+ * otherwise the Regex falls back to simulating the NFA. Expressions that only join literals with '|' and concatenation
+ * skip determinization: the trie of the literals is run as a DfaTable, or by a LiteralMatcher when it is over the limits
+ * and for long words against a few literals. get_engine tells which one eval uses.
+ *
+ * eval and match do not modify the Regex, so one compiled Regex can be shared between threads.
+ */
+
 class Regex {
 public:
-    explicit Regex(std::string expr);
-    bool eval(const std::string &word);
+    enum Engine {
+        DFA,
+        NFA,
+        LITERAL
+    };
+
+    static constexpr DfaLimits default_limits = {10000, 64u << 20};
+
+    explicit Regex(std::string expr, const DfaLimits &limits = default_limits);
+    bool eval(std::string_view word) const;
+
+    /*
+     * Evaluates many words at once, results[i] telling whether words[i] matches. With the DFA and LITERAL engines the
+     * words are run in lockstep over the transition table (see DfaTable::accept_batch), which pays off for many short
+     * words.
+     */
+
+    void eval_batch(const std::vector<std::string_view> &words, std::vector<bool> &results) const;
+
+    /*
+     * Matches the whole word like eval, but also extracts the capturing groups in a single pass. groups[0] is the
+     * whole match and groups[i] is the i-th group, counted by its opening parenthesis. Unmatched groups are left unset.
+     */
+
+    bool match(std::string_view word, std::vector<Submatch> &groups) const;
     void set_expr(const std::string &new_expr);
+    [[nodiscard]] Engine get_engine() const;
+
+    /*
+     * The lambda NFA if get_engine is NFA, a DFA otherwise (for LITERAL, the trie of the literals). It can be combined
+     * with the automaton of other expressions (&, |, -) to check a compound condition in a single pass.
+     */
+
+    [[nodiscard]] const Automaton &get_automaton() const;
+
+    /*
+     * The limits the Regex was compiled with, to pass to the Automaton operations that determinize (complement,
+     * difference, includes) when they are applied to get_automaton.
+     */
+
+    [[nodiscard]] const DfaLimits &get_limits() const;
 private:
     Automaton l_nfa;
+    Automaton dfa;
+    DfaTable dfa_table;
+    LiteralMatcher literal_matcher;
+    bool literal_table = false; // dfa_table holds the trie of a LITERAL expression
+    Engine engine;
+    DfaLimits limits;
+    PikeVM vm;
     std::string expr;
     SyntaxTree tree;
 
+    /*
+     * Thompson construction over the AST, built in place in a single automaton. Subtrees that occur more than once (see
+     * SyntaxTree::structural_ids) are compiled once and their block of states is copied for every other occurrence.
+     */
+
     Automaton construct_nfa();
+    void compile();
 };
 
 /*
@@ -62,6 +138,8 @@ private:
  * star' :- '*' | epsilon
  * primary :- literal | '(' expr ')' ;
  *
+ * Every '(' expr ')' is recorded in the AST as a GROUP node, numbered in the order of its opening parenthesis.
+ *
  * For LL(1)
  *
  * FIRST(expr) = { literal, ( }
@@ -110,6 +188,7 @@ private:
         M_CONCAT_PR,
         M_STAR,
         M_STAR_PR,
+        M_GROUP,
         M_END,
         P_STAR_T,    // 0
         P_OR_T,      // 1
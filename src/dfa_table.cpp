@@ -0,0 +1,141 @@
+#include "dfa_table.h"
+#include <algorithm>
+
+DfaTable::DfaTable() : table(256, dead_state), terminal(1, 0), init_state(dead_state) {}
+
+DfaTable::DfaTable(const Automaton &dfa) : init_state(dead_state) {
+    const auto &nodes = dfa.get_nodes();
+    std::vector<int> states;
+    for(const auto &key_node : nodes) {
+        states.push_back(key_node.first);
+    }
+    std::sort(states.begin(), states.end());
+    if(states.size() + 1 > max_states) throw DfaLimitExceeded(states.size() + 1, (states.size() + 1) * row_bytes);
+    std::unordered_map<int, uint32_t> offsets;
+    for(size_t i = 0; i < states.size(); i++) {
+        offsets[states[i]] = static_cast<uint32_t>((i + 1) * 256);
+    }
+
+    this->table.assign((states.size() + 1) * 256, dead_state);
+    this->terminal.assign(states.size() + 1, 0);
+    for(size_t i = 0; i < states.size(); i++) {
+        const Node &node = nodes.at(states[i]);
+        this->terminal[i + 1] = node.check_is_terminal();
+        uint32_t *row = this->table.data() + (i + 1) * 256;
+        for(const auto &edge : node.get_edges()) {
+            if(edge.get_trans_char() == '-') throw NfaHasLambda();
+            uint32_t &entry = row[static_cast<unsigned char>(edge.get_trans_char())];
+            uint32_t dest = offsets.at(edge.get_dest());
+            if(entry != dead_state && entry != dest) throw AutomatonNotDeterministic();
+            entry = dest;
+        }
+    }
+    auto init = offsets.find(dfa.get_init_state());
+    if(init != offsets.end()) this->init_state = init->second;
+}
+
+size_t DfaTable::state_count() const {
+    return this->terminal.size();
+}
+
+bool DfaTable::accept(std::string_view word) const {
+    const uint32_t *table = this->table.data();
+    uint32_t state = this->init_state;
+    for(const auto &ch : word) {
+        state = table[state + static_cast<unsigned char>(ch)];
+        if(state == dead_state) return false;
+    }
+    return this->terminal[state >> 8];
+}
+
+/*
+ * Steps state over [begin, end), stopping early in the dead state.
+ */
+
+uint32_t DfaTable::run(uint32_t state, const unsigned char *begin, const unsigned char *end) const {
+    const uint32_t *table = this->table.data();
+    for(; begin != end && state != dead_state; begin++) {
+        state = table[state + *begin];
+    }
+    return state;
+}
+
+void DfaTable::accept_batch(const std::vector<std::string_view> &words, std::vector<bool> &results) const {
+    constexpr size_t lanes = 8;
+    constexpr size_t max_steps = 8;
+    const uint32_t *table = this->table.data();
+    results.assign(words.size(), false);
+
+    uint32_t states[lanes];
+    const unsigned char *positions[lanes];
+    size_t remaining[lanes], indexes[lanes];
+    size_t next = 0;
+
+    // Loads the next non empty word into the lane, returns false once there are no words left.
+    auto load = [&](size_t lane) {
+        for(; next < words.size(); next++) {
+            if(words[next].empty()) {
+                results[next] = this->terminal[this->init_state >> 8];
+                continue;
+            }
+            states[lane] = this->init_state;
+            positions[lane] = reinterpret_cast<const unsigned char *>(words[next].data());
+            remaining[lane] = words[next].size();
+            indexes[lane] = next++;
+            return true;
+        }
+        return false;
+    };
+
+    size_t loaded = 0;
+    while(loaded < lanes && load(loaded)) loaded++;
+    if(loaded < lanes) {
+        for(size_t lane = 0; lane < loaded; lane++) {
+            results[indexes[lane]] = this->accept(words[indexes[lane]]);
+        }
+        return;
+    }
+
+    bool words_left = true;
+    while(words_left) {
+        // Every lane is advanced by the length left of the shortest word, at most max_steps chars so that dead lanes
+        // are noticed soon. The lanes are kept in separate locals so that they stay in registers and the 8 loads of a
+        // step overlap. A dead lane keeps reading row 0, which only leads back to the dead state.
+        size_t steps = std::min(*std::min_element(remaining, remaining + lanes), max_steps);
+        uint32_t s0 = states[0], s1 = states[1], s2 = states[2], s3 = states[3];
+        uint32_t s4 = states[4], s5 = states[5], s6 = states[6], s7 = states[7];
+        const unsigned char *p0 = positions[0], *p1 = positions[1], *p2 = positions[2], *p3 = positions[3];
+        const unsigned char *p4 = positions[4], *p5 = positions[5], *p6 = positions[6], *p7 = positions[7];
+        for(size_t pos = 0; pos < steps; pos++) {
+            s0 = table[s0 + p0[pos]];
+            s1 = table[s1 + p1[pos]];
+            s2 = table[s2 + p2[pos]];
+            s3 = table[s3 + p3[pos]];
+            s4 = table[s4 + p4[pos]];
+            s5 = table[s5 + p5[pos]];
+            s6 = table[s6 + p6[pos]];
+            s7 = table[s7 + p7[pos]];
+        }
+        states[0] = s0, states[1] = s1, states[2] = s2, states[3] = s3;
+        states[4] = s4, states[5] = s5, states[6] = s6, states[7] = s7;
+
+        // A lane whose word ended or died stores its result and takes the next word.
+        for(size_t lane = 0; lane < lanes; lane++) {
+            positions[lane] += steps;
+            remaining[lane] -= steps;
+            if(remaining[lane] != 0 && states[lane] != dead_state) continue;
+            results[indexes[lane]] = this->terminal[states[lane] >> 8];
+            if(!words_left || !load(lane)) {
+                words_left = false;
+                remaining[lane] = 0;
+            }
+        }
+    }
+
+    // Out of words, the lanes that are still running are finished one by one.
+    for(size_t lane = 0; lane < lanes; lane++) {
+        if(remaining[lane] == 0) continue;
+        uint32_t state = this->run(states[lane], positions[lane], positions[lane] + remaining[lane]);
+        results[indexes[lane]] = this->terminal[state >> 8];
+    }
+}
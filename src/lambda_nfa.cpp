@@ -1,6 +1,12 @@
 #include "lambda_nfa.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <exception>
+#include <mutex>
 #include <queue>
-#include <map>
+#include <thread>
 
 Edge::Edge(char trans_char, int dest) : trans_char(trans_char), dest(dest) {}
 
@@ -49,35 +55,54 @@ void Automaton::insert_edge(int dest, int src, char tc) {
     this->nodes[src].insert_edge(Edge(tc, dest));
 }
 
-bool Automaton::accept(const std::string &word) {
-    std::vector<std::tuple<int, int> > stack; //state, index
-    std::unordered_map<int, std::unordered_set<int> > visited;
+void Automaton::set_terminal(int state, bool is) {
+    this->nodes[state].set_terminal(is);
+}
+
+void Automaton::set_init_state(int state) {
+    this->init_state = state;
+}
+
+int Automaton::get_init_state() const {
+    return this->init_state;
+}
+
+const std::unordered_map<int, Node> &Automaton::get_nodes() const {
+    return this->nodes;
+}
+
+bool Automaton::accept(std::string_view word) const {
+    std::vector<std::tuple<int, size_t> > stack; //state, index
+    std::unordered_map<int, std::unordered_set<size_t> > visited;
     stack.emplace_back(init_state, 0);
     while(!stack.empty()) {
         int state = std::get<0>(stack.back());
-        int index = std::get<1>(stack.back());
+        size_t index = std::get<1>(stack.back());
         stack.pop_back();
 
+        auto node = nodes.find(state);
+        if(node == nodes.end()) continue;
+
         if(index == word.length()) {
-            if(nodes[state].check_is_terminal()) {
+            if(node->second.check_is_terminal()) {
                 return true;
             }
         }
 
         visited[state].insert(index);
 
-        for(auto &edge : nodes[state].get_edges()) {
-            int dest_state = nodes[edge.get_dest()].get_state();
-            if(edge.get_trans_char() == word[index]) {
-                if(visited[dest_state].find(index + 1) == visited[dest_state].end()) {
-                    stack.emplace_back(dest_state, index + 1);
-                }
-            }
-            else if(edge.get_trans_char() == '-') {
+        for(auto &edge : node->second.get_edges()) {
+            int dest_state = edge.get_dest();
+            if(edge.get_trans_char() == '-') {
                 if(visited[dest_state].find(index) == visited[dest_state].end()) {
                     stack.emplace_back(dest_state, index);
                 }
             }
+            else if(index < word.length() && edge.get_trans_char() == word[index]) {
+                if(visited[dest_state].find(index + 1) == visited[dest_state].end()) {
+                    stack.emplace_back(dest_state, index + 1);
+                }
+            }
         }
     }
     return false;
@@ -223,69 +248,339 @@ Automaton Automaton::operator*() {
     return result;
 }
 
-Automaton::CharSet Automaton::get_trans_char_set(const IntSet &state_set) const {
-    CharSet trans_char_set;
-    for(const auto &state : state_set) {
-        const Node &node = this->nodes.at(state);
-        for(const auto &edge : node.get_edges()) {
-            if(edge.get_trans_char() == '-') throw NfaHasLambda();
-            trans_char_set.insert(edge.get_trans_char());
-        }
+Automaton::StateSet::StateSet(size_t state_count) : words((state_count + 63) / 64, 0), hash_value(0) {}
+
+void Automaton::StateSet::insert(int state) {
+    this->words[state >> 6] |= uint64_t(1) << (state & 63);
+}
+
+bool Automaton::StateSet::contains(int state) const {
+    return (this->words[state >> 6] >> (state & 63)) & 1;
+}
+
+bool Automaton::StateSet::empty() const {
+    return std::all_of(this->words.begin(), this->words.end(), [](uint64_t word) { return word == 0; });
+}
+
+bool Automaton::StateSet::intersects(const StateSet &other) const {
+    for(size_t i = 0; i < this->words.size(); i++) {
+        if(this->words[i] & other.words[i]) return true;
     }
-    return trans_char_set;
+    return false;
 }
 
-bool Automaton::check_state_set_terminal(const IntSet &state_set) {
-    for(const auto &state : state_set) {
-        if(this->nodes[state].check_is_terminal()) {
-            return true;
+size_t Automaton::StateSet::hash() const {
+    return this->hash_value;
+}
+
+/*
+ * Computes the hash once the set is complete. Sets are never modified after they are sealed.
+ */
+
+void Automaton::StateSet::seal() {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(const auto &word : this->words) {
+        h = (h ^ word) * 0x100000001b3ull;
+        h ^= h >> 29;
+    }
+    this->hash_value = static_cast<size_t>(h);
+}
+
+bool Automaton::StateSet::operator==(const StateSet &other) const {
+    return this->hash_value == other.hash_value && this->words == other.words;
+}
+
+template<typename F>
+void Automaton::StateSet::for_each(F f) const {
+    for(size_t i = 0; i < this->words.size(); i++) {
+        uint64_t word = this->words[i];
+        while(word) {
+            f(static_cast<int>(i * 64 + std::countr_zero(word)));
+            word &= word - 1;
         }
     }
-    return false;
 }
 
-Automaton::IntSet Automaton::get_state_set(const IntSet &state_set, char trans_char) const {
-    IntSet new_state_set;
+Automaton::DenseNfa Automaton::make_dense() const {
+    DenseNfa dense;
+    std::unordered_map<int, int> new_keys;
 
-    for(const auto &state : state_set) {
-        const Node &node = this->nodes.at(state);
+    // The initial state and edge destinations may have no Node (e.g. a default constructed Automaton, which accepts
+    // nothing). They are kept as non-terminal states without edges.
+    dense.states.push_back(this->init_state);
+    for(const auto &key_node : this->nodes) {
+        dense.states.push_back(key_node.first);
+        for(const auto &edge : key_node.second.get_edges()) dense.states.push_back(edge.get_dest());
+    }
+    std::sort(dense.states.begin(), dense.states.end());
+    dense.states.erase(std::unique(dense.states.begin(), dense.states.end()), dense.states.end());
+    for(size_t i = 0; i < dense.states.size(); i++) {
+        new_keys[dense.states[i]] = static_cast<int>(i);
+    }
+
+    dense.edges.resize(dense.states.size());
+    dense.lambda_edges.resize(dense.states.size());
+    dense.terminal = StateSet(dense.states.size());
+    for(size_t i = 0; i < dense.states.size(); i++) {
+        auto node_it = this->nodes.find(dense.states[i]);
+        if(node_it == this->nodes.end()) continue;
+        const Node &node = node_it->second;
+        if(node.check_is_terminal()) dense.terminal.insert(static_cast<int>(i));
         for(const auto &edge : node.get_edges()) {
-            if(edge.get_trans_char() == trans_char) new_state_set.insert(edge.get_dest());
-            else if(edge.get_trans_char() == '-') throw NfaHasLambda();
+            if(edge.get_trans_char() == '-') dense.lambda_edges[i].push_back(new_keys.at(edge.get_dest()));
+            else dense.edges[i].emplace_back(edge.get_trans_char(), new_keys.at(edge.get_dest()));
         }
     }
-
-    return new_state_set;
+    dense.init_state = new_keys.at(this->init_state);
+    return dense;
 }
 
-Automaton Automaton::to_dfa() {
+Automaton Automaton::to_dfa(const DfaLimits &limits) const {
+    using Successors = std::vector<std::pair<char, StateSet> >;
+
+    const DenseNfa dense = this->make_dense();
+    const size_t state_count = dense.states.size();
+
+    /*
+     * Memory accounting. Every allocation that grows with the DFA is reserved in dfa_bytes before it is made, so the
+     * construction aborts before going over limits.max_bytes rather than after. A heap block is counted with
+     * allocation_overhead bytes of allocator bookkeeping, a hash table entry with its node and bucket pointers, and a
+     * vector element twice to cover the growth of the vector.
+     *
+     * The count starts with the automaton itself and its DenseNfa.
+     */
+
+    constexpr size_t allocation_overhead = 16;
+    constexpr size_t hash_entry_overhead = allocation_overhead + 2 * sizeof(void *) + sizeof(size_t);
+    const size_t bitset_bytes = (state_count + 63) / 64 * sizeof(uint64_t) + allocation_overhead;
+    const size_t successor_bytes = 2 * sizeof(std::pair<char, StateSet>) + bitset_bytes;
+    const size_t state_bytes = sizeof(std::pair<const int, Node>) + hash_entry_overhead      // result.nodes
+                               + sizeof(std::pair<const StateSet, int>) + hash_entry_overhead // state_map
+                               + 2 * sizeof(std::pair<StateSet, int>)                         // frontier
+                               + 2 * bitset_bytes
+                               + limits.extra_state_bytes;
+    const size_t edge_bytes = 2 * sizeof(Edge);
+
+    size_t input_bytes = 0;
+    for(const auto &key_node : this->nodes) {
+        input_bytes += sizeof(std::pair<const int, Node>) + hash_entry_overhead
+                       + key_node.second.get_edges().capacity() * sizeof(Edge) + allocation_overhead;
+    }
+    for(size_t i = 0; i < state_count; i++) {
+        input_bytes += sizeof(int) + sizeof(dense.edges[i]) + dense.edges[i].capacity() * sizeof(dense.edges[i][0])
+                       + sizeof(dense.lambda_edges[i]) + dense.lambda_edges[i].capacity() * sizeof(int)
+                       + 2 * allocation_overhead;
+    }
+
+    std::atomic<size_t> dfa_bytes = input_bytes + state_bytes;
+    size_t dfa_states = 1;
+
+    auto reserve_bytes = [&dfa_bytes, &dfa_states, &limits](size_t bytes) {
+        const size_t total = dfa_bytes.fetch_add(bytes) + bytes;
+        if(total > limits.max_bytes) throw DfaLimitExceeded(dfa_states, total);
+    };
+    if(dfa_bytes > limits.max_bytes) throw DfaLimitExceeded(dfa_states, dfa_bytes);
+
+    /*
+     * Adds to a state set every state reachable from it by lambda transitions. It works in place on the bitset, so it
+     * allocates nothing but the stack.
+     */
+
+    auto close = [&dense](StateSet &state_set) {
+        std::vector<int> stack;
+        state_set.for_each([&](int state) {
+            if(!dense.lambda_edges[state].empty()) stack.push_back(state);
+        });
+        while(!stack.empty()) {
+            int state = stack.back();
+            stack.pop_back();
+            for(const auto &dest : dense.lambda_edges[state]) {
+                if(state_set.contains(dest)) continue;
+                state_set.insert(dest);
+                stack.push_back(dest);
+            }
+        }
+    };
+
+    /*
+     * All successors of a state set, one per transition char, sorted by char and closed under lambda transitions.
+     * Every successor set is reserved as it is created; the caller releases the reservation once the successors are
+     * numbered.
+     */
+
+    auto expand = [&dense, state_count, successor_bytes, &reserve_bytes, &close](const StateSet &state_set) {
+        std::array<int, 256> slot;
+        slot.fill(-1);
+        Successors successors;
+        state_set.for_each([&](int state) {
+            for(const auto &edge : dense.edges[state]) {
+                int &index = slot[static_cast<unsigned char>(edge.first)];
+                if(index < 0) {
+                    reserve_bytes(successor_bytes);
+                    index = static_cast<int>(successors.size());
+                    successors.emplace_back(edge.first, StateSet(state_count));
+                }
+                successors[index].second.insert(edge.second);
+            }
+        });
+        std::sort(successors.begin(), successors.end(), [](const auto &a, const auto &b) {
+            return static_cast<unsigned char>(a.first) < static_cast<unsigned char>(b.first);
+        });
+        for(auto &successor : successors) {
+            close(successor.second);
+            successor.second.seal();
+        }
+        return successors;
+    };
+
     Automaton result;
+    result.init_state = 0;
+    result.insert_node(0);
+
+    StateSet init_set(state_count);
+    init_set.insert(dense.init_state);
+    close(init_set);
+    init_set.seal();
+    if(init_set.intersects(dense.terminal)) result.nodes[0].set_terminal(true);
+
+    std::unordered_map<StateSet, int, StateSet::Hash> state_map;
+    state_map.emplace(init_set, 0);
+    std::vector<std::pair<StateSet, int> > frontier = {{init_set, 0}};
     int new_state_index = 0;
+
+    /*
+     * A frontier is expanded in batches of at most max_batch sets, so the successor sets waiting to be numbered are
+     * bounded no matter how wide the frontier gets.
+     */
+
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    constexpr size_t min_sets_per_thread = 32;
+    const size_t max_batch = 4 * min_sets_per_thread * thread_count;
+
+    while(!frontier.empty()) {
+        std::vector<std::pair<StateSet, int> > next_frontier;
+
+        for(size_t first = 0; first < frontier.size(); first += max_batch) {
+            const size_t last = std::min(frontier.size(), first + max_batch);
+            std::vector<Successors> successors(last - first);
+            size_t workers = std::min(thread_count, (last - first) / min_sets_per_thread);
+
+            if(workers <= 1) {
+                for(size_t i = first; i < last; i++) {
+                    successors[i - first] = expand(frontier[i].first);
+                }
+            }
+            else {
+                std::atomic<size_t> next = first;
+                std::exception_ptr error;
+                std::mutex error_mutex;
+                std::vector<std::thread> threads;
+                for(size_t w = 0; w < workers; w++) {
+                    threads.emplace_back([&]() {
+                        try {
+                            for(size_t i = next++; i < last; i = next++) {
+                                successors[i - first] = expand(frontier[i].first);
+                            }
+                        }
+                        catch(...) {
+                            std::lock_guard<std::mutex> lock(error_mutex);
+                            if(!error) error = std::current_exception();
+                            next = last;
+                        }
+                    });
+                }
+                for(auto &thread : threads) thread.join();
+                if(error) std::rethrow_exception(error);
+            }
+
+            for(size_t i = first; i < last; i++) {
+                for(auto &successor : successors[i - first]) {
+                    auto it = state_map.find(successor.second);
+                    if(it == state_map.end()) {
+                        if(dfa_states + 1 > limits.max_states) throw DfaLimitExceeded(dfa_states, dfa_bytes);
+                        reserve_bytes(state_bytes);
+                        dfa_states++;
+                        result.insert_node(++new_state_index);
+                        if(successor.second.intersects(dense.terminal)) result.nodes[new_state_index].set_terminal(true);
+                        it = state_map.emplace(successor.second, new_state_index).first;
+                        next_frontier.emplace_back(std::move(successor.second), new_state_index);
+                    }
+                    reserve_bytes(edge_bytes);
+                    result.insert_edge(it->second, frontier[i].second, successor.first);
+                }
+                dfa_bytes -= successors[i - first].size() * successor_bytes;
+                successors[i - first] = Successors();
+            }
+        }
+        frontier = std::move(next_frontier);
+    }
+
+    return result;
+}
+
+Automaton Automaton::without_lambda() const {
+    const DenseNfa dense = this->make_dense();
+
+    Automaton result;
+    result.init_state = this->init_state;
+
+    // The closure of every state is walked with a stamped visited array, so no closure is kept in memory.
+    std::vector<size_t> visited(dense.states.size(), 0);
+    std::vector<int> stack;
+    for(size_t i = 0; i < dense.states.size(); i++) {
+        const int state = dense.states[i];
+        result.insert_node(state);
+        stack.push_back(static_cast<int>(i));
+        visited[i] = i + 1;
+        while(!stack.empty()) {
+            int current = stack.back();
+            stack.pop_back();
+            if(dense.terminal.contains(current)) result.nodes[state].set_terminal(true);
+            for(const auto &edge : dense.edges[current]) {
+                result.insert_edge(dense.states[edge.second], state, edge.first);
+            }
+            for(const auto &dest : dense.lambda_edges[current]) {
+                if(visited[dest] == i + 1) continue;
+                visited[dest] = i + 1;
+                stack.push_back(dest);
+            }
+        }
+    }
+    return result;
+}
+
+Automaton Automaton::operator&(const Automaton &other) const {
+    const DenseNfa a = this->without_lambda().make_dense();
+    const DenseNfa b = other.without_lambda().make_dense();
+    const auto pair_key = [&b](int p, int q) {
+        return static_cast<uint64_t>(p) * b.states.size() + q;
+    };
+
+    Automaton result;
     result.init_state = 0;
     result.insert_node(0);
 
-    std::queue<IntSet> queue;
-    queue.push({this->init_state});
-    std::map<IntSet, int> state_map;
-    state_map[queue.front()] = 0;
+    std::unordered_map<uint64_t, int> pair_map;
+    std::queue<std::pair<int, int> > queue;
+    pair_map[pair_key(a.init_state, b.init_state)] = 0;
+    queue.emplace(a.init_state, b.init_state);
 
     while(!queue.empty()) {
-        IntSet state_set = queue.front();
+        auto [p, q] = queue.front();
         queue.pop();
-
-        const CharSet trans_char_set = this->get_trans_char_set(state_set);
-
-        for(const auto &trans_char : trans_char_set) {
-            IntSet new_state_set = this->get_state_set(state_set, trans_char);
-            if(!new_state_set.empty()) {
-                if(state_map.find(new_state_set) == state_map.end()) {
-                    queue.push(new_state_set);
-                    result.insert_node(++new_state_index);
-                    state_map[new_state_set] = new_state_index;
+        int state = pair_map.at(pair_key(p, q));
+        if(a.terminal.contains(p) && b.terminal.contains(q)) result.nodes[state].set_terminal(true);
+
+        for(const auto &edge_a : a.edges[p]) {
+            for(const auto &edge_b : b.edges[q]) {
+                if(edge_a.first != edge_b.first) continue;
+                auto [it, inserted] = pair_map.emplace(pair_key(edge_a.second, edge_b.second),
+                                                       static_cast<int>(pair_map.size()));
+                if(inserted) {
+                    result.insert_node(it->second);
+                    queue.emplace(edge_a.second, edge_b.second);
                 }
-                result.insert_edge(state_map.at(new_state_set), state_map.at(state_set), trans_char);
-                if(this->check_state_set_terminal(new_state_set))
-                    result.nodes[new_state_index].set_terminal(true);
+                result.insert_edge(it->second, state, edge_a.first);
             }
         }
     }
@@ -293,6 +588,86 @@ Automaton Automaton::to_dfa() {
     return result;
 }
 
+Automaton &Automaton::operator&=(const Automaton &other) {
+    *this = *this & other;
+    return *this;
+}
+
+Automaton Automaton::complement(const std::set<char> &alphabet, const DfaLimits &limits) const {
+    const DenseNfa dfa = this->to_dfa(limits).make_dense();
+    const int sink = static_cast<int>(dfa.states.size());
+
+    Automaton result;
+    result.init_state = dfa.states[dfa.init_state];
+    for(size_t i = 0; i < dfa.states.size(); i++) {
+        const int state = dfa.states[i];
+        result.insert_node(state);
+        result.nodes[state].set_terminal(!dfa.terminal.contains(static_cast<int>(i)));
+
+        std::set<char> missing = alphabet;
+        for(const auto &edge : dfa.edges[i]) {
+            if(alphabet.count(edge.first) == 0) continue;
+            result.insert_edge(dfa.states[edge.second], state, edge.first);
+            missing.erase(edge.first);
+        }
+        for(const auto &trans_char : missing) {
+            result.insert_edge(sink, state, trans_char);
+        }
+    }
+
+    // to_dfa numbers its states 0..n-1, so sink is a fresh state.
+    result.insert_node(sink);
+    result.nodes[sink].set_terminal(true);
+    for(const auto &trans_char : alphabet) {
+        result.insert_edge(sink, sink, trans_char);
+    }
+
+    return result;
+}
+
+Automaton Automaton::difference(const Automaton &other, const DfaLimits &limits) const {
+    return *this & other.complement(this->alphabet(), limits);
+}
+
+Automaton Automaton::operator-(const Automaton &other) const {
+    return this->difference(other);
+}
+
+Automaton &Automaton::operator-=(const Automaton &other) {
+    *this = *this - other;
+    return *this;
+}
+
+std::set<char> Automaton::alphabet() const {
+    std::set<char> result;
+    for(const auto &key_node : this->nodes) {
+        for(const auto &edge : key_node.second.get_edges()) {
+            if(edge.get_trans_char() != '-') result.insert(edge.get_trans_char());
+        }
+    }
+    return result;
+}
+
+bool Automaton::is_empty() const {
+    std::unordered_set<int> visited = {this->init_state};
+    std::vector<int> stack = {this->init_state};
+    while(!stack.empty()) {
+        int state = stack.back();
+        stack.pop_back();
+        auto node = this->nodes.find(state);
+        if(node == this->nodes.end()) continue;
+        if(node->second.check_is_terminal()) return false;
+        for(const auto &edge : node->second.get_edges()) {
+            if(visited.insert(edge.get_dest()).second) stack.push_back(edge.get_dest());
+        }
+    }
+    return true;
+}
+
+bool Automaton::includes(const Automaton &other, const DfaLimits &limits) const {
+    return other.difference(*this, limits).is_empty();
+}
+
 std::istream &operator>>(std::istream &in, Automaton &automaton) {
     int num_states;
     in >> num_states;
@@ -0,0 +1,177 @@
+#include "literal_matcher.h"
+#include "regex_engine.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+LiteralMatcher::LiteralMatcher() : use_trie(false) {}
+
+LiteralMatcher::LiteralMatcher(std::vector<std::string> literals) : use_trie(literals.size() > packed_limit) {
+    std::sort(literals.begin(), literals.end());
+    literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+
+    if(this->use_trie) {
+        this->build_trie(literals);
+        return;
+    }
+    for(const auto &literal : literals) {
+        if(literal.size() > 16) {
+            this->long_literals.push_back(literal);
+            continue;
+        }
+        std::array<char, 16> block{};
+        std::memcpy(block.data(), literal.data(), literal.size());
+        this->packed.push_back(block);
+        this->packed_lengths.push_back(static_cast<uint8_t>(literal.size()));
+    }
+}
+
+/*
+ * The literals are sorted, so the children of every node are created in increasing char order and the nodes can be
+ * numbered in BFS order with their edges already sorted.
+ */
+
+void LiteralMatcher::build_trie(const std::vector<std::string> &literals) {
+    std::vector<std::vector<std::pair<unsigned char, uint32_t> > > children(1);
+    std::vector<uint8_t> is_terminal(1, 0);
+    for(const auto &literal : literals) {
+        uint32_t node = 0;
+        for(const auto &ch : literal) {
+            auto &edges = children[node];
+            const auto uch = static_cast<unsigned char>(ch);
+            if(edges.empty() || edges.back().first != uch) {
+                edges.emplace_back(uch, static_cast<uint32_t>(children.size()));
+                children.emplace_back();
+                is_terminal.push_back(0);
+            }
+            node = children[node].back().second;
+        }
+        is_terminal[node] = 1;
+    }
+
+    std::vector<uint32_t> order = {0}, new_index(children.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        new_index[order[i]] = static_cast<uint32_t>(i);
+        for(const auto &edge : children[order[i]]) order.push_back(edge.second);
+    }
+
+    this->edge_begin.push_back(0);
+    for(const auto &node : order) {
+        for(const auto &edge : children[node]) {
+            this->edge_chars.push_back(edge.first);
+            this->edge_dest.push_back(new_index[edge.second]);
+        }
+        this->edge_begin.push_back(static_cast<uint32_t>(this->edge_chars.size()));
+        this->terminal.push_back(is_terminal[node]);
+    }
+}
+
+bool LiteralMatcher::match(std::string_view word) const {
+    if(this->use_trie) {
+        uint32_t node = 0;
+        for(const auto &ch : word) {
+            const unsigned char *begin = this->edge_chars.data() + this->edge_begin[node];
+            const unsigned char *end = this->edge_chars.data() + this->edge_begin[node + 1];
+            const unsigned char *edge = std::lower_bound(begin, end, static_cast<unsigned char>(ch));
+            if(edge == end || *edge != static_cast<unsigned char>(ch)) return false;
+            node = this->edge_dest[edge - this->edge_chars.data()];
+        }
+        return this->terminal[node];
+    }
+
+    if(word.size() > 16) {
+        return std::find(this->long_literals.begin(), this->long_literals.end(), word) != this->long_literals.end();
+    }
+    alignas(16) char block[16] = {};
+    std::memcpy(block, word.data(), word.size());
+#ifdef __SSE2__
+    const __m128i packed_word = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+    for(size_t i = 0; i < this->packed.size(); i++) {
+        const __m128i literal = _mm_loadu_si128(reinterpret_cast<const __m128i *>(this->packed[i].data()));
+        if(this->packed_lengths[i] == word.size() && _mm_movemask_epi8(_mm_cmpeq_epi8(packed_word, literal)) == 0xffff) {
+            return true;
+        }
+    }
+#else
+    for(size_t i = 0; i < this->packed.size(); i++) {
+        if(this->packed_lengths[i] == word.size() && std::memcmp(block, this->packed[i].data(), 16) == 0) return true;
+    }
+#endif
+    return false;
+}
+
+bool LiteralMatcher::is_packed() const {
+    return !this->packed.empty() || !this->long_literals.empty();
+}
+
+bool LiteralMatcher::extract(const SyntaxTree &tree, std::vector<std::string> &literals) {
+    // Children are always emplaced before their father, so the words of the children are known when a node is reached.
+    const std::vector<SyntaxTreeNode> &nodes = tree.get_nodes();
+    std::vector<std::vector<std::string> > words(nodes.size());
+    for(size_t i = 0; i < nodes.size(); i++) {
+        const SyntaxTreeNode &node = nodes[i];
+        const std::vector<int> &children = node.get_children();
+        switch(node.get_type()) {
+            case SyntaxTreeNode::LITERAL:
+                // '-' is a lambda transition in the automaton path, so it is left to that path to keep the same results.
+                if(node.get_value() == '-') return false;
+                words[i] = {std::string(1, node.get_value())};
+                break;
+            case SyntaxTreeNode::GROUP:
+                words[i] = std::move(words[children[0]]);
+                break;
+            case SyntaxTreeNode::OR: {
+                // The literals are a set, so the smaller operand is moved into the larger one. The operands are freed
+                // rather than cleared, a long chain of ORs would otherwise keep the capacity of every level.
+                auto &larger = words[children[0]].size() > words[children[1]].size() ? words[children[0]]
+                                                                                      : words[children[1]];
+                auto &smaller = &larger == &words[children[0]] ? words[children[1]] : words[children[0]];
+                words[i] = std::move(larger);
+                words[i].insert(words[i].end(), std::make_move_iterator(smaller.begin()),
+                                std::make_move_iterator(smaller.end()));
+                larger = {};
+                smaller = {};
+                if(words[i].size() > max_literals) return false;
+                break;
+            }
+            case SyntaxTreeNode::CONCAT:
+                if(words[children[1]].size() * words[children[0]].size() > max_literals) return false;
+                // children are stored right operand first
+                for(const auto &prefix : words[children[1]]) {
+                    for(const auto &suffix : words[children[0]]) words[i].push_back(prefix + suffix);
+                }
+                words[children[0]] = {};
+                words[children[1]] = {};
+                break;
+            case SyntaxTreeNode::STAR:
+                return false;
+        }
+    }
+    literals = std::move(words[tree.root_index()]);
+    return true;
+}
+
+Automaton LiteralMatcher::to_automaton(const std::vector<std::string> &literals) {
+    Automaton result;
+    result.insert_node(0);
+    std::unordered_map<uint64_t, int> children;
+    int state_count = 1;
+    for(const auto &literal : literals) {
+        int state = 0;
+        for(const auto &ch : literal) {
+            const uint64_t key = static_cast<uint64_t>(state) << 8 | static_cast<unsigned char>(ch);
+            auto [child, inserted] = children.emplace(key, state_count);
+            if(inserted) {
+                result.insert_node(state_count++);
+                result.insert_edge(child->second, state, ch);
+            }
+            state = child->second;
+        }
+        result.set_terminal(state);
+    }
+    return result;
+}
@@ -0,0 +1,259 @@
+#include "pike_vm.h"
+#include "regex_engine.h"
+#include <stack>
+#include <utility>
+#include <algorithm>
+
+bool Submatch::matched() const {
+    return this->begin >= 0;
+}
+
+PikeVM::PikeVM() : start(0), groups(0) {
+    this->program.push_back({Instruction::MATCH, 0, -1, -1});
+}
+
+PikeVM::PikeVM(const SyntaxTree &tree) : start(0), groups(tree.group_count()) {
+    this->compile(tree);
+}
+
+int PikeVM::group_count() const {
+    return this->groups;
+}
+
+const std::vector<Instruction> &PikeVM::get_program() const {
+    return this->program;
+}
+
+/*
+ * Thompson style compilation with patch lists. Every fragment has a start instruction and a list of dangling exits
+ * that are patched once the instruction that follows the fragment is known. The AST is walked in postorder with an
+ * explicit stack, the same way Regex::construct_nfa does it, so deep expressions do not overflow the call stack.
+ *
+ * A '-' literal is a lambda transition in the Thompson NFA, so here it compiles to an empty fragment (start -1, no
+ * exits) that its parent links straight through, keeping match in agreement with eval.
+ */
+
+void PikeVM::compile(const SyntaxTree &tree) {
+    struct fragment {
+        int start;
+        std::vector<std::pair<int, bool> > outs; // instruction, patch y instead of x
+    };
+    struct tree_index {
+        int index;
+        bool push_fragment;
+        tree_index(int index, bool push_fragment) : index(index), push_fragment(push_fragment) {}
+    };
+
+    auto emit = [this](Instruction::Opcode op, char trans_char, int x, int y) {
+        this->program.push_back({op, trans_char, x, y});
+        return static_cast<int>(this->program.size() - 1);
+    };
+    auto patch = [this](const fragment &frag, int dest) {
+        for(const auto &out : frag.outs) {
+            if(out.second) this->program[out.first].y = dest;
+            else this->program[out.first].x = dest;
+        }
+    };
+
+    std::stack<tree_index> tree_stack;
+    std::stack<fragment> fragment_stack;
+    tree_stack.emplace(tree.root_index(), false);
+
+    const std::vector<SyntaxTreeNode> &tree_nodes = tree.get_nodes();
+
+    while(!tree_stack.empty()) {
+        int node_index = tree_stack.top().index;
+        const SyntaxTreeNode &tree_node = tree_nodes[node_index];
+        bool push_fragment = tree_stack.top().push_fragment;
+        tree_stack.pop();
+
+        if(!push_fragment) {
+            tree_stack.emplace(node_index, true);
+            for(const auto &child : tree_node.get_children()) {
+                tree_stack.emplace(child, false);
+            }
+            continue;
+        }
+
+        fragment frag, f1, f2;
+        int inst, group_end;
+        switch(tree_node.get_type()) {
+            case SyntaxTreeNode::LITERAL:
+                if(tree_node.get_value() == '-') {
+                    frag = {-1, {}};
+                    break;
+                }
+                inst = emit(Instruction::CHAR, tree_node.get_value(), -1, -1);
+                frag = {inst, {{inst, false}}};
+                break;
+            case SyntaxTreeNode::STAR:
+                f1 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                if(f1.start < 0) {
+                    frag = std::move(f1);
+                    break;
+                }
+                inst = emit(Instruction::SPLIT, 0, f1.start, -1);
+                patch(f1, inst);
+                frag = {inst, {{inst, true}}};
+                break;
+            case SyntaxTreeNode::OR:
+                f1 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                f2 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                inst = emit(Instruction::SPLIT, 0, f2.start, f1.start);
+                frag = {inst, {}};
+                if(f2.start < 0) frag.outs.emplace_back(inst, false);
+                frag.outs.insert(frag.outs.end(), f2.outs.begin(), f2.outs.end());
+                if(f1.start < 0) frag.outs.emplace_back(inst, true);
+                frag.outs.insert(frag.outs.end(), f1.outs.begin(), f1.outs.end());
+                break;
+            case SyntaxTreeNode::CONCAT:
+                f1 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                f2 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                if(f2.start < 0) {
+                    frag = std::move(f1);
+                }
+                else if(f1.start < 0) {
+                    frag = std::move(f2);
+                }
+                else {
+                    patch(f2, f1.start);
+                    frag = {f2.start, std::move(f1.outs)};
+                }
+                break;
+            case SyntaxTreeNode::GROUP:
+                f1 = std::move(fragment_stack.top());
+                fragment_stack.pop();
+                inst = emit(Instruction::SAVE, 0, f1.start, 2 * tree_node.get_group());
+                group_end = emit(Instruction::SAVE, 0, -1, 2 * tree_node.get_group() + 1);
+                if(f1.start < 0) this->program[inst].x = group_end;
+                else patch(f1, group_end);
+                frag = {inst, {{group_end, false}}};
+                break;
+        }
+        fragment_stack.push(std::move(frag));
+    }
+
+    const fragment &body = fragment_stack.top();
+    this->start = emit(Instruction::SAVE, 0, body.start, 0);
+    int end = emit(Instruction::SAVE, 0, -1, 1);
+    if(body.start < 0) this->program[this->start].x = end;
+    else patch(body, end);
+    this->program[end].x = emit(Instruction::MATCH, 0, -1, -1);
+}
+
+namespace {
+    /*
+     * A sparse set of program counters that keeps insertion order (which is thread priority) and the capture slots of
+     * every thread. Everything is allocated once per match, sized by the program.
+     */
+
+    class ThreadList {
+    public:
+        ThreadList(size_t program_size, size_t slots)
+            : dense(program_size), sparse(program_size), caps(program_size * slots), slots(slots), size(0) {}
+
+        [[nodiscard]] bool contains(int pc) const {
+            return this->sparse[pc] < this->size && this->dense[this->sparse[pc]] == pc;
+        }
+
+        void insert(int pc) {
+            this->sparse[pc] = this->size;
+            this->dense[this->size++] = pc;
+        }
+
+        std::ptrdiff_t *thread_caps(int pc) {
+            return this->caps.data() + pc * this->slots;
+        }
+
+        void clear() {
+            this->size = 0;
+        }
+
+        std::vector<int> dense;
+        std::vector<size_t> sparse;
+        std::vector<std::ptrdiff_t> caps;
+        size_t slots;
+        size_t size;
+    };
+}
+
+bool PikeVM::match(std::string_view word, std::vector<Submatch> &groups) const {
+    struct job {
+        int pc;
+        int restore_slot;
+        std::ptrdiff_t restore_value;
+    };
+
+    const size_t slots = 2 * (this->groups + 1);
+    ThreadList clist(this->program.size(), slots), nlist(this->program.size(), slots);
+    std::vector<std::ptrdiff_t> caps(slots, -1);
+    std::vector<job> stack;
+
+    /*
+     * Follows every SPLIT and SAVE reachable from pc without consuming input and adds the resulting CHAR and MATCH
+     * threads to the list. SAVE changes caps in place and pushes a job that restores the old value before the lower
+     * priority branches are explored.
+     */
+
+    auto add_thread = [this, &stack, &caps](ThreadList &list, int pc, std::ptrdiff_t pos) {
+        stack.push_back({pc, -1, 0});
+        while(!stack.empty()) {
+            job current = stack.back();
+            stack.pop_back();
+            if(current.restore_slot >= 0) {
+                caps[current.restore_slot] = current.restore_value;
+                continue;
+            }
+            pc = current.pc;
+            while(!list.contains(pc)) {
+                list.insert(pc);
+                const Instruction &inst = this->program[pc];
+                if(inst.op == Instruction::SPLIT) {
+                    stack.push_back({inst.y, -1, 0});
+                    pc = inst.x;
+                }
+                else if(inst.op == Instruction::SAVE) {
+                    stack.push_back({0, inst.y, caps[inst.y]});
+                    caps[inst.y] = pos;
+                    pc = inst.x;
+                }
+                else {
+                    std::copy(caps.begin(), caps.end(), list.thread_caps(pc));
+                    break;
+                }
+            }
+        }
+    };
+
+    add_thread(clist, this->start, 0);
+
+    for(size_t index = 0; index <= word.length() && clist.size > 0; index++) {
+        for(size_t i = 0; i < clist.size; i++) {
+            int pc = clist.dense[i];
+            const Instruction &inst = this->program[pc];
+            if(inst.op == Instruction::MATCH) {
+                if(index < word.length()) continue;
+                const std::ptrdiff_t *thread_caps = clist.thread_caps(pc);
+                groups.assign(this->groups + 1, Submatch());
+                for(size_t group = 0; group < groups.size(); group++) {
+                    if(thread_caps[2 * group] >= 0 && thread_caps[2 * group + 1] >= 0) {
+                        groups[group] = {thread_caps[2 * group], thread_caps[2 * group + 1]};
+                    }
+                }
+                return true;
+            }
+            if(inst.op == Instruction::CHAR && index < word.length() && inst.trans_char == word[index]) {
+                std::copy(clist.thread_caps(pc), clist.thread_caps(pc) + slots, caps.begin());
+                add_thread(nlist, inst.x, static_cast<std::ptrdiff_t>(index + 1));
+            }
+        }
+        std::swap(clist, nlist);
+        nlist.clear();
+    }
+    return false;
+}
@@ -3,6 +3,8 @@
 #include <stack>
 #include <cassert>
 #include <iostream>
+#include <unordered_map>
+#include <algorithm>
 
 std::vector<Parser::Symbol> Parser::prod_table[prod_count][terminal_count] = {
 {{}, {}, {P_CONCAT, P_EXPR_PR, M_EXPR}, {}, {P_CONCAT, P_EXPR_PR, M_EXPR}, {}},
@@ -11,10 +13,10 @@ std::vector<Parser::Symbol> Parser::prod_table[prod_count][terminal_count] = {
 {{}, {P_EPSILON}, {P_STAR, P_CONCAT_PR, M_CONCAT_PR}, {P_EPSILON}, {P_STAR, P_CONCAT_PR, M_CONCAT_PR}, {P_EPSILON}},
 {{}, {}, {P_PRIMARY, P_STAR_PR, M_STAR}, {}, {P_PRIMARY, P_STAR_PR, M_STAR}, {}},
 {{P_STAR_T, M_STAR_PR}, {P_EPSILON}, {P_EPSILON}, {P_EPSILON}, {P_EPSILON}, {P_EPSILON}},
-{{}, {}, {P_LPAREN_T, P_EXPR, P_RPAREN_T}, {}, {P_LITERAL_T}, {}}
+{{}, {}, {P_LPAREN_T, P_EXPR, P_RPAREN_T, M_GROUP}, {}, {P_LITERAL_T}, {}}
 };
 
-SyntaxTreeNode::SyntaxTreeNode(NodeType type, char ch) : type(type), value(ch) {}
+SyntaxTreeNode::SyntaxTreeNode(NodeType type, char ch, int group) : type(type), value(ch), group(group) {}
 
 int SyntaxTree::root_index() const {
     return static_cast<int>(this->nodes.size() - 1);
@@ -40,83 +42,270 @@ void SyntaxTreeNode::insert_child(int node_index) {
     this->children.push_back(node_index);
 }
 
-int SyntaxTree::emplace_node(SyntaxTreeNode::NodeType type, char value) {
-    this->nodes.emplace_back(type, value);
+int SyntaxTree::emplace_node(SyntaxTreeNode::NodeType type, char value, int group) {
+    this->nodes.emplace_back(type, value, group);
+    if(group > this->groups) this->groups = group;
     return static_cast<int>(this->nodes.size() - 1);
 }
 
-Regex::Regex(std::string expr) : expr(std::move(expr)) {
+int SyntaxTree::group_count() const {
+    return this->groups;
+}
+
+std::vector<int> SyntaxTree::structural_ids() const {
+    struct key_hash {
+        size_t operator()(const std::vector<int> &key) const {
+            size_t h = key.size();
+            for(const auto &k : key) h ^= std::hash<int>()(k) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h;
+        }
+    };
+
+    // Children are always emplaced before their father, so the ids of the children are known when a node is reached.
+    std::unordered_map<std::vector<int>, int, key_hash> ids;
+    std::vector<int> result(this->nodes.size());
+    for(size_t i = 0; i < this->nodes.size(); i++) {
+        const SyntaxTreeNode &node = this->nodes[i];
+        if(node.get_type() == SyntaxTreeNode::GROUP) {
+            result[i] = result[node.get_children().front()];
+            continue;
+        }
+        std::vector<int> key = {node.get_type(), node.get_value()};
+        for(const auto &child : node.get_children()) key.push_back(result[child]);
+        result[i] = ids.emplace(std::move(key), static_cast<int>(ids.size())).first->second;
+    }
+    return result;
+}
+
+Regex::Regex(std::string expr, const DfaLimits &limits) : engine(NFA), limits(limits), expr(std::move(expr)) {
+    this->compile();
+}
+
+void Regex::compile() {
     this->tree = Parser::parse(this->expr);
+    this->vm = PikeVM(this->tree);
+
+    std::vector<std::string> literals;
+    if(LiteralMatcher::extract(this->tree, literals)) {
+        // The trie of the literals is already a DFA, so neither the Thompson NFA nor the subset construction is needed.
+        // Its table is used unless it goes over the limits, and the packed compare is kept for the small sets where it
+        // wins on long words.
+        this->l_nfa = Automaton();
+        this->dfa = LiteralMatcher::to_automaton(literals);
+        const size_t states = this->dfa.get_nodes().size() + 1;
+        this->literal_table = states <= std::min(this->limits.max_states, DfaTable::max_states) &&
+                              states <= this->limits.max_bytes / DfaTable::row_bytes;
+        this->dfa_table = this->literal_table ? DfaTable(this->dfa) : DfaTable();
+        if(!this->literal_table || literals.size() <= LiteralMatcher::packed_limit) {
+            this->literal_matcher = LiteralMatcher(std::move(literals));
+        }
+        else {
+            this->literal_matcher = LiteralMatcher();
+        }
+        this->engine = LITERAL;
+        return;
+    }
+    this->literal_matcher = LiteralMatcher();
+    this->literal_table = false;
     this->l_nfa = this->construct_nfa();
+
+    // The table built from the DFA is counted in the limits too, one row per state.
+    DfaLimits dfa_limits = this->limits;
+    dfa_limits.max_states = std::min(dfa_limits.max_states, DfaTable::max_states - 1);
+    dfa_limits.extra_state_bytes += DfaTable::row_bytes;
+    try {
+        this->dfa = this->l_nfa.to_dfa(dfa_limits);
+        this->dfa_table = DfaTable(this->dfa);
+        this->engine = DFA;
+    }
+    catch(const DfaLimitExceeded &) {
+        this->dfa = Automaton();
+        this->dfa_table = DfaTable();
+        this->engine = NFA;
+    }
+}
+
+Regex::Engine Regex::get_engine() const {
+    return this->engine;
+}
+
+const Automaton &Regex::get_automaton() const {
+    return this->engine == NFA ? this->l_nfa : this->dfa;
+}
+
+const DfaLimits &Regex::get_limits() const {
+    return this->limits;
 }
 
 char SyntaxTreeNode::get_value() const {
     return this->value;
 }
 
+int SyntaxTreeNode::get_group() const {
+    return this->group;
+}
+
 Automaton Regex::construct_nfa() {
     struct tree_index {
         int index;
-        bool push_automaton;
-        tree_index(int index, bool push_automaton) : index(index), push_automaton(push_automaton) {}
+        bool push_fragment;
+        int first_state;
+        tree_index(int index, bool push_fragment, int first_state = 0)
+            : index(index), push_fragment(push_fragment), first_state(first_state) {}
+    };
+
+    // A Thompson fragment: its states are [first_state, last_state) and end is its only accepting state.
+    struct fragment {
+        int start;
+        int end;
+        int first_state;
+        int last_state;
+    };
+
+    Automaton result;
+    int state_count = 0;
+    auto new_state = [&result, &state_count]() {
+        result.insert_node(state_count);
+        return state_count++;
     };
 
     std::stack<tree_index> tree_stack;
-    std::stack<Automaton> automaton_stack;
+    std::stack<fragment> fragment_stack;
     tree_stack.emplace(this->tree.root_index(), false);
 
     const std::vector<SyntaxTreeNode> &tree_nodes = this->tree.get_nodes();
 
+    /*
+     * Only the subtrees that occur more than once are memoized. The states of a subtree are numbered consecutively, so
+     * another occurrence is a copy of that block of states, shifted. The edges that leave the block were added by the
+     * parents of the first occurrence and are not copied.
+     */
+
+    const std::vector<int> structural_ids = this->tree.structural_ids();
+    std::unordered_map<int, int> occurrences;
+    for(size_t i = 0; i < tree_nodes.size(); i++) {
+        if(tree_nodes[i].get_type() != SyntaxTreeNode::GROUP) occurrences[structural_ids[i]]++;
+    }
+    std::unordered_map<int, fragment> fragments;
+
+    /*
+     * Every operator links its operands in place with lambda transitions, so the construction is linear in the size
+     * of the AST instead of copying the operands into a new automaton at every node.
+     */
+
     while(!tree_stack.empty()) {
-        int node_index = tree_stack.top().index;
-        const SyntaxTreeNode &tree_node = tree_nodes[node_index];
-        bool push_automaton = tree_stack.top().push_automaton;
+        const tree_index current = tree_stack.top();
+        const SyntaxTreeNode &tree_node = tree_nodes[current.index];
         tree_stack.pop();
 
-        if(push_automaton) {
-            Automaton automaton, a1, a2;
+        if(current.push_fragment) {
+            fragment frag{}, f1, f2;
             switch(tree_node.get_type()) {
                 case SyntaxTreeNode::LITERAL:
-                    automaton_stack.emplace(tree_node.get_value());
+                    // A '-' literal becomes a lambda transition, as in Automaton(char).
+                    frag.start = new_state();
+                    frag.end = new_state();
+                    result.insert_edge(frag.end, frag.start, tree_node.get_value());
                     break;
                 case SyntaxTreeNode::STAR:
-                    automaton = *automaton_stack.top();
-                    automaton_stack.pop();
-                    automaton_stack.push(automaton);
+                    f1 = fragment_stack.top();
+                    fragment_stack.pop();
+                    frag.start = frag.end = new_state();
+                    result.insert_edge(f1.start, frag.start, '-');
+                    result.insert_edge(frag.end, f1.end, '-');
                     break;
                 case SyntaxTreeNode::OR:
-                    a1 = automaton_stack.top();
-                    automaton_stack.pop();
-                    a2 = automaton_stack.top();
-                    automaton_stack.pop();
-                    automaton = a2 | a1;
-                    automaton_stack.push(automaton);
+                    f1 = fragment_stack.top();
+                    fragment_stack.pop();
+                    f2 = fragment_stack.top();
+                    fragment_stack.pop();
+                    frag.start = new_state();
+                    frag.end = new_state();
+                    result.insert_edge(f2.start, frag.start, '-');
+                    result.insert_edge(f1.start, frag.start, '-');
+                    result.insert_edge(frag.end, f2.end, '-');
+                    result.insert_edge(frag.end, f1.end, '-');
                     break;
                 case SyntaxTreeNode::CONCAT:
-                    a1 = automaton_stack.top();
-                    automaton_stack.pop();
-                    a2 = automaton_stack.top();
-                    automaton_stack.pop();
-                    automaton = a2 * a1;
-                    automaton_stack.push(automaton);
+                    f1 = fragment_stack.top();
+                    fragment_stack.pop();
+                    f2 = fragment_stack.top();
+                    fragment_stack.pop();
+                    result.insert_edge(f1.start, f2.end, '-');
+                    frag.start = f2.start;
+                    frag.end = f1.end;
+                    break;
+                case SyntaxTreeNode::GROUP:
+                    frag = fragment_stack.top();
+                    fragment_stack.pop();
                     break;
             }
+            frag.first_state = current.first_state;
+            frag.last_state = state_count;
+            fragment_stack.push(frag);
+            if(occurrences[structural_ids[current.index]] > 1) {
+                fragments.emplace(structural_ids[current.index], frag);
+            }
         }
         else {
-            tree_stack.emplace(node_index, true);
+            auto memo = fragments.find(structural_ids[current.index]);
+            if(memo != fragments.end()) {
+                const fragment &original = memo->second;
+                const int shift = state_count - original.first_state;
+                for(int state = original.first_state; state < original.last_state; state++) {
+                    new_state();
+                }
+                for(int state = original.first_state; state < original.last_state; state++) {
+                    // Copied from a vector of the automaton that the loop inserts into, so it is iterated by index.
+                    for(size_t i = 0; i < result.get_nodes().at(state).get_edges().size(); i++) {
+                        const Edge edge = result.get_nodes().at(state).get_edges()[i];
+                        if(edge.get_dest() < original.first_state || edge.get_dest() >= original.last_state) continue;
+                        result.insert_edge(edge.get_dest() + shift, state + shift, edge.get_trans_char());
+                    }
+                }
+                fragment_stack.push({original.start + shift, original.end + shift, original.first_state + shift,
+                                     original.last_state + shift});
+                continue;
+            }
+            tree_stack.emplace(current.index, true, state_count);
             const std::vector<int> &children = tree_node.get_children();
             for(const auto &child : children) {
                 tree_stack.emplace(child, false);
             }
         }
     }
-    return automaton_stack.top();
+
+    const fragment &body = fragment_stack.top();
+    result.set_init_state(body.start);
+    result.set_terminal(body.end);
+    return result;
 }
 
-bool Regex::eval(const std::string &word) {
+bool Regex::eval(std::string_view word) const {
+    if(this->engine == DFA) return this->dfa_table.accept(word);
+    if(this->engine == LITERAL) {
+        // The packed compare costs the same for any word, the table one step per char.
+        const bool packed = this->literal_matcher.is_packed() && word.size() >= LiteralMatcher::packed_min_length;
+        return this->literal_table && !packed ? this->dfa_table.accept(word) : this->literal_matcher.match(word);
+    }
     return this->l_nfa.accept(word);
 }
 
+void Regex::eval_batch(const std::vector<std::string_view> &words, std::vector<bool> &results) const {
+    if(this->engine == DFA || (this->engine == LITERAL && this->literal_table)) {
+        this->dfa_table.accept_batch(words, results);
+        return;
+    }
+    results.assign(words.size(), false);
+    for(size_t i = 0; i < words.size(); i++) {
+        results[i] = this->eval(words[i]);
+    }
+}
+
+bool Regex::match(std::string_view word, std::vector<Submatch> &groups) const {
+    return this->vm.match(word, groups);
+}
+
 Parser::Symbol Parser::char_to_symbol(char ch) {
     switch(ch) {
         case '*':
@@ -140,12 +329,14 @@ SyntaxTree Parser::parse(const std::string &expr) {
     SyntaxTree tree;
 
     std::stack<int> value_stack;
+    std::stack<int> group_stack;
+    int group_count = 0;
     std::stack<Symbol> prod_stack;
     prod_stack.push(M_END);
     prod_stack.push(P_EXPR);
 
     auto expr_it = expr.begin();
-    Symbol term_sym = Parser::char_to_symbol(*expr_it);
+    Symbol term_sym = expr.empty() ? EOF_T : Parser::char_to_symbol(*expr_it);
 
     while(!prod_stack.empty()) {
         Symbol curr_prod = prod_stack.top();
@@ -157,14 +348,15 @@ SyntaxTree Parser::parse(const std::string &expr) {
         }
 
         if(curr_prod >= P_STAR_T) {
-            if(expr_it == expr.end()) break;
-
-            assert(curr_prod == term_sym);
+            if(expr_it == expr.end() || curr_prod != term_sym) break;
 
             if(term_sym == P_LITERAL_T) {
                 int node_index = tree.emplace_node(SyntaxTreeNode::LITERAL, *expr_it);
                 value_stack.push(node_index);
             }
+            else if(term_sym == P_LPAREN_T) {
+                group_stack.push(++group_count);
+            }
 
             expr_it++;
             if(expr_it == expr.end()) {
@@ -210,7 +402,14 @@ SyntaxTree Parser::parse(const std::string &expr) {
                     tree.insert_child(node, value_stack.top());
                     value_stack.pop();
                     break;
+                case M_GROUP:
+                    node = tree.emplace_node(SyntaxTreeNode::GROUP, 0, group_stack.top());
+                    group_stack.pop();
+                    tree.insert_child(node, value_stack.top());
+                    value_stack.pop();
+                    break;
                 case M_END:
+                    if(expr_it != expr.end()) throw ExpressionNotRegex();
                     return tree;
                 default:
                     break;
@@ -222,7 +421,9 @@ SyntaxTree Parser::parse(const std::string &expr) {
         assert(curr_prod < Parser::prod_count);
         assert(term_sym - P_STAR_T < Parser::terminal_count);
 
-        std::vector<Symbol> production = Parser::prod_table[curr_prod][term_sym - P_STAR_T];
+        // An empty table entry means no production applies to this terminal, so the expression is not valid.
+        const std::vector<Symbol> &production = Parser::prod_table[curr_prod][term_sym - P_STAR_T];
+        if(production.empty()) break;
         for(auto it = production.end() - 1; !production.empty() && it >= production.begin(); it--) {
             prod_stack.push(*it);
         }
@@ -232,6 +433,5 @@ SyntaxTree Parser::parse(const std::string &expr) {
 
 void Regex::set_expr(const std::string &new_expr) {
     this->expr = new_expr;
-    this->tree = Parser::parse(new_expr);
-    this->l_nfa = this->construct_nfa();
+    this->compile();
 }
\ No newline at end of file